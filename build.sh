@@ -1,15 +1,12 @@
 #! /bin/bash
 
-if ! [ -e build ]; then
-	mkdir build
-fi
+# Usage: build.sh [build type] [extra CMake arguments]
+# The build type defaults to Release. See CMakeLists.txt for the available options.
 
-if ! [ -d build ]; then
-	echo "ERROR: unable to create 'build' directory"
-	exit 1
-fi
+BUILD_TYPE="${1:-Release}"
+(( $# > 0 )) && shift
 
-gcc -c "src/gtkscalableimage.c" -o "build/gtkscalableimage.o" $(pkg-config --cflags --libs gtk+-3.0) -g
+cmake -S . -B build -DCMAKE_BUILD_TYPE="$BUILD_TYPE" "$@" && cmake --build build
 if [[ $? != 0 ]]; then
 	echo "Build failed"
 	exit 1
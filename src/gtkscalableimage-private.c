@@ -2,34 +2,139 @@
 
 typedef struct _GtkRequisition Size;
 
+/* Height in pixels of the horizontal bands used by gtk_scalable_image_render_region() */
+#define RENDER_BAND_HEIGHT 128
+/* Size in source pixels of the pieces of a band that are converted at once */
+#define RENDER_CHUNK_SIZE  512
+
+/* Size in pixels of the display-mapped tiles drawn when the image goes through the display mapping */
+#define TILE_SIZE         256
+#define MAX_CACHED_TILES  256
+#define MAX_TILE_LEVEL    15
+#define TILE_KEY(level, x, y) GUINT_TO_POINTER(((guint)(level) << 28) | ((guint)(y) << 14) | (guint)(x))
+
+/* Children per node of the overlay R-tree */
+#define OVERLAY_NODE_CAPACITY 16
+/* Width in screen pixels of the overlay outlines */
+#define OVERLAY_LINE_WIDTH    1.0
+/* Shapes smaller than this many screen pixels are drawn as a filled box */
+#define OVERLAY_LOD_SIZE      3.0
+
+/* Number of entries of the table that maps normalized float samples to display values */
+#define CURVE_SIZE 4096
+
+/* With GTK_SCALABLE_IMAGE_SIMD_DISPATCH the pixel kernels are built for several instruction sets
+ * and the best one for the running CPU is picked when the library is loaded */
+#if defined(GTK_SCALABLE_IMAGE_SIMD_DISPATCH) && defined(__GNUC__) && defined(__x86_64__)
+#define KERNEL __attribute__((target_clones("avx2", "sse4.1", "default")))
+#else
+#define KERNEL
+#endif
+
 struct _GtkScalableImagePrivate
 {
-	void* placeholder;
+	/* Source set with gtk_scalable_image_set_data(). Mutually exclusive with the pixbuf */
+	GBytes*                data;
+	GtkScalableImageFormat format;
+	gint                   n_channels;
+	gint                   width;
+	gint                   height;
+	gint                   rowstride;
+
+	/* Display mapping. The tables are rebuilt and mapping_version is bumped whenever a parameter changes */
+	double                 window;
+	double                 level;
+	double                 brightness;
+	double                 contrast;
+	double                 gamma;
+	guint32*               lut;
+	guint                  mapping_version;
+	gboolean               mapping_is_identity;
+	guint8                 curve[CURVE_SIZE]; /* normalized sample -> display value */
+	guint8*                table;             /* sample -> display value, NULL for float sources */
+
+	/* Display-mapped tiles of the visible area, keyed by TILE_KEY() */
+	GHashTable*            tiles;
+	/* Box-filtered copies of the source, mips[L - 1] is level L. Built on first use */
+	GPtrArray*             mips;
+
+	/* Annotations in image coordinates, in insertion order (so by increasing id).
+	 * The R-trees cover the first overlay_indexed_count overlays in consecutive runs, oldest and largest first.
+	 * Later overlays are scanned linearly. Removed overlays stay in place, flagged, until they are the majority */
+	GPtrArray*             overlays;
+	GArray*                overlay_trees;
+	gint                   overlay_indexed_count;
+	gint                   overlay_removed_count;
+	guint                  next_overlay_id;
 };
 
+/* An annotation. Rectangles have no points, polygons are closed implicitly */
+typedef struct
+{
+	guint    id;
+	gboolean removed;
+	GdkRGBA  color;
+	double   x1, y1, x2, y2;
+	gint     n_points;
+	double*  points;
+} Overlay;
+
+/* A box of the overlay R-tree. The index is a flat array: the leaf boxes of the overlays come first,
+ * followed by each level of nodes, the root last. Nodes point to a contiguous range of the level below */
+typedef struct
+{
+	double x1, y1, x2, y2;
+	gint   first; /* first child box, or index in priv->overlays for leaves */
+	gint   count; /* number of children, 0 for leaves */
+} OverlayBox;
+
+/* An R-tree over the overlays from first to first + count - 1.
+ * Boxes are stored level by level, leaves first and root last */
+typedef struct
+{
+	gint    first;
+	gint    count;
+	GArray* boxes;
+} OverlayTree;
+
+/* A copy of the source halved L times, each sample is the average of the 2x2 samples of level L - 1.
+ * Same format and channels as the source, rows are packed */
+typedef struct
+{
+	guchar* pixels;
+	gint    width;
+	gint    height;
+	gint    rowstride;
+} Mip;
+
+/* A display-mapped piece of the image. At level L each tile pixel covers 2^L x 2^L image pixels */
+typedef struct
+{
+	cairo_surface_t* surface;
+	guint            version;
+} Tile;
+
 enum
 {
 	PROP_HADJUSTMENT = 1,
 	PROP_VADJUSTMENT,
 	PROP_HSCROLL_POLICY,
 	PROP_VSCROLL_POLICY,
+	PROP_BRIGHTNESS,
+	PROP_CONTRAST,
+	PROP_GAMMA,
+	N_PROPERTIES
 };
 
+static GParamSpec* properties[N_PROPERTIES] = { NULL, };
 
-/* Returns the widget size needed to display the whole image at the current scale.
- * For example an 800x600 image needs 400x300 pixels when scaled to 0.5. */
+
+/* Returns TRUE if either a pixbuf or a data source is set */
 static
-Size
-_gtk_scalable_image_get_minimum_size(GtkScalableImage* self)
+gboolean
+_gtk_scalable_image_has_image(GtkScalableImage* self)
 {
-	g_assert(self->scale > 0.0);
-	Size result = { 0, 0 };
-	if(self->pixbuf)
-	{
-		result.width  = (gint)(self->scale * gdk_pixbuf_get_width(self->pixbuf));
-		result.height = (gint)(self->scale * gdk_pixbuf_get_height(self->pixbuf));
-	}
-	return result;
+	return self->pixbuf || self->priv->data;
 }
 
 
@@ -45,6 +150,24 @@ _gtk_scalable_image_get_natural_size(GtkScalableImage* self)
 		result.width  = gdk_pixbuf_get_width(self->pixbuf);
 		result.height = gdk_pixbuf_get_height(self->pixbuf);
 	}
+	else if(self->priv->data)
+	{
+		result.width  = self->priv->width;
+		result.height = self->priv->height;
+	}
+	return result;
+}
+
+
+/* Returns the widget size needed to display the whole image at the current scale.
+ * For example an 800x600 image needs 400x300 pixels when scaled to 0.5. */
+static
+Size
+_gtk_scalable_image_get_minimum_size(GtkScalableImage* self)
+{
+	g_assert(self->scale > 0.0);
+	Size natural_size = _gtk_scalable_image_get_natural_size(self);
+	Size result = { (gint)(self->scale * natural_size.width), (gint)(self->scale * natural_size.height) };
 	return result;
 }
 
@@ -81,12 +204,12 @@ _gtk_scalable_image_adjust_viewport_position(GtkScalableImage* self)
 	if(self->viewport.width > image_size.width)
 		self->viewport.x = -(self->viewport.width - image_size.width) / 2;
 	else
-		CLAMP(self->viewport.x, 0, image_size.width - self->viewport.width);
+		self->viewport.x = CLAMP(self->viewport.x, 0, image_size.width - self->viewport.width);
 	
 	if(self->viewport.height > image_size.height)
 		self->viewport.y = -(self->viewport.height - image_size.height) / 2;
 	else
-		CLAMP(self->viewport.y, 0, image_size.height - self->viewport.height);
+		self->viewport.y = CLAMP(self->viewport.y, 0, image_size.height - self->viewport.height);
 }
 
 
@@ -105,7 +228,7 @@ _gtk_scalable_image_reset_adjustments(GtkScalableImage* self)
 	gdouble upper[2]     = { 0.0, 0.0 };
 	gdouble page_size[2] = { 0.0, 0.0 };
 
-	if(self->pixbuf)
+	if(_gtk_scalable_image_has_image(self))
 	{
 		Size image_size = _gtk_scalable_image_get_natural_size(self);
 		value[0] = (gdouble)CLAMP(self->viewport.x, 0, image_size.width - self->viewport.width);
@@ -162,4 +285,1210 @@ _gtk_scalable_image_set_adjustment(GtkScalableImage* self,
 		                 G_CALLBACK(gtk_scalable_image_on_signal_adjustment_value_changed), self);
 		gtk_scalable_image_on_signal_adjustment_value_changed(new_adjustment, self);
 	}
-}
\ No newline at end of file
+}
+
+
+
+
+/* Maps a sample normalized by the window to a display value.
+ * Contrast scales around mid-grey, then brightness is added, then gamma is applied */
+static
+guint8
+_gtk_scalable_image_map_normalized(GtkScalableImagePrivate* priv, double value)
+{
+	value = CLAMP(value, 0.0, 1.0);
+	value = (value - 0.5) * priv->contrast + 0.5 + priv->brightness;
+	value = CLAMP(value, 0.0, 1.0);
+	if(priv->gamma != 1.0)
+		value = pow(value, 1.0 / priv->gamma);
+	return (guint8)(value * 255.0 + 0.5);
+}
+
+
+/* Sets the window to the full range of the source format */
+static
+void
+_gtk_scalable_image_reset_window(GtkScalableImage* self)
+{
+	GtkScalableImagePrivate* priv = self->priv;
+	GtkScalableImageFormat format = priv->data ? priv->format : GTK_SCALABLE_IMAGE_FORMAT_UINT8;
+	switch(format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:  priv->window = 255.0;   break;
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16: priv->window = 65535.0; break;
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:  priv->window = 1.0;     break;
+	}
+	priv->level = priv->window / 2.0;
+}
+
+
+/* Rebuilds the mapping tables after a change of the source format or of the display mapping
+ * parameters, and invalidates the cached tiles */
+static
+void
+_gtk_scalable_image_update_mapping(GtkScalableImage* self)
+{
+	GtkScalableImagePrivate* priv = self->priv;
+	GtkScalableImageFormat format = priv->data ? priv->format : GTK_SCALABLE_IMAGE_FORMAT_UINT8;
+
+	for(gint i = 0; i < CURVE_SIZE; ++i)
+		priv->curve[i] = _gtk_scalable_image_map_normalized(priv, (double)i / (CURVE_SIZE - 1));
+
+	g_clear_pointer(&priv->table, g_free);
+	if(format != GTK_SCALABLE_IMAGE_FORMAT_FLOAT)
+	{
+		gint   size = format == GTK_SCALABLE_IMAGE_FORMAT_UINT8 ? 256 : 65536;
+		double low  = priv->level - priv->window / 2.0;
+		priv->table = g_malloc(size);
+		for(gint i = 0; i < size; ++i)
+			priv->table[i] = _gtk_scalable_image_map_normalized(priv, (i - low) / priv->window);
+	}
+
+	priv->mapping_is_identity = format == GTK_SCALABLE_IMAGE_FORMAT_UINT8 && !priv->lut;
+	for(gint i = 0; priv->mapping_is_identity && i < 256; ++i)
+		priv->mapping_is_identity = priv->table[i] == i;
+
+	priv->mapping_version += 1;
+}
+
+
+/* Snapshot of the image data and display mapping taken on the main thread, so that the
+ * render workers never touch the widget or the pixbuf object */
+typedef struct
+{
+	const guchar*          pixels;
+	GtkScalableImageFormat format;
+	gint                   width;
+	gint                   height;
+	gint                   rowstride;
+	gint                   n_channels;
+	gboolean               has_alpha;
+
+	const guint8*          table;
+	const guint8*          curve;
+	const guint32*         lut;
+	gfloat                 low;
+	gfloat                 inverse_window;
+} ImageSource;
+
+
+static
+gboolean
+_gtk_scalable_image_get_source(GtkScalableImage* self, ImageSource* source)
+{
+	GtkScalableImagePrivate* priv = self->priv;
+	if(self->pixbuf)
+	{
+		/* gdk_pixbuf_get_pixels() may have to copy the data out of a GBytes, so do it here */
+		source->pixels     = gdk_pixbuf_get_pixels(self->pixbuf);
+		source->format     = GTK_SCALABLE_IMAGE_FORMAT_UINT8;
+		source->width      = gdk_pixbuf_get_width(self->pixbuf);
+		source->height     = gdk_pixbuf_get_height(self->pixbuf);
+		source->rowstride  = gdk_pixbuf_get_rowstride(self->pixbuf);
+		source->n_channels = gdk_pixbuf_get_n_channels(self->pixbuf);
+	}
+	else if(priv->data)
+	{
+		source->pixels     = g_bytes_get_data(priv->data, NULL);
+		source->format     = priv->format;
+		source->width      = priv->width;
+		source->height     = priv->height;
+		source->rowstride  = priv->rowstride;
+		source->n_channels = priv->n_channels;
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	source->has_alpha      = source->n_channels == 2 || source->n_channels == 4;
+	source->table          = priv->table;
+	source->curve          = priv->curve;
+	source->lut            = priv->lut;
+	source->low            = (gfloat)(priv->level - priv->window / 2.0);
+	source->inverse_window = (gfloat)(1.0 / priv->window);
+	return TRUE;
+}
+
+
+/* Kernels of the display mapping. They work on one channel of a row at a time and are kept
+ * free of branches and calls so that the compiler can vectorize them */
+static
+KERNEL
+void
+_gtk_scalable_image_map_uint8(const guint8* restrict samples,
+                              gint                   count,
+                              gint                   stride,
+                              const guint8* restrict table,
+                              guint8* restrict       values)
+{
+	for(gint i = 0; i < count; ++i)
+		values[i] = table[samples[i * stride]];
+}
+
+
+static
+KERNEL
+void
+_gtk_scalable_image_map_uint16(const guint16* restrict samples,
+                               gint                    count,
+                               gint                    stride,
+                               const guint8* restrict  table,
+                               guint8* restrict        values)
+{
+	for(gint i = 0; i < count; ++i)
+		values[i] = table[samples[i * stride]];
+}
+
+
+/* NaN samples map to the bottom of the window */
+static
+KERNEL
+void
+_gtk_scalable_image_quantize_float(const gfloat* restrict samples,
+                                   gint                   count,
+                                   gint                   stride,
+                                   gfloat                 low,
+                                   gfloat                 inverse_window,
+                                   gint32* restrict       indices)
+{
+	/* Clamping after the rounding offset keeps the conversion to integer in range,
+	 * which the vectorizer needs to prove */
+	gfloat factor = inverse_window * (CURVE_SIZE - 1);
+	for(gint i = 0; i < count; ++i)
+	{
+		gfloat index = (samples[i * stride] - low) * factor + 0.5f;
+		index = index > 0.0f ? index : 0.0f;
+		index = index < (gfloat)(CURVE_SIZE - 1) ? index : (gfloat)(CURVE_SIZE - 1);
+		indices[i] = (gint32)index;
+	}
+}
+
+
+static
+KERNEL
+void
+_gtk_scalable_image_map_float(const gfloat* restrict samples,
+                              gint                   count,
+                              gint                   stride,
+                              gfloat                 low,
+                              gfloat                 inverse_window,
+                              const guint8* restrict curve,
+                              gint32* restrict       indices,
+                              guint8* restrict       values)
+{
+	_gtk_scalable_image_quantize_float(samples, count, stride, low, inverse_window, indices);
+	for(gint i = 0; i < count; ++i)
+		values[i] = curve[indices[i]];
+}
+
+
+/* Alpha is never windowed, only scaled to 8 bits */
+static
+void
+_gtk_scalable_image_map_alpha(const ImageSource* source,
+                              const guchar*      row,
+                              gint               count,
+                              gint               stride,
+                              gint32* restrict   indices,
+                              guint8* restrict   values)
+{
+	switch(source->format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:
+		{
+			const guint8* samples = row;
+			for(gint i = 0; i < count; ++i)
+				values[i] = samples[i * stride];
+		} break;
+
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16:
+		{
+			const guint16* samples = (const guint16*)row;
+			for(gint i = 0; i < count; ++i)
+				values[i] = samples[i * stride] >> 8;
+		} break;
+
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:
+		{
+			_gtk_scalable_image_quantize_float((const gfloat*)row, count, stride, 0.0f, 1.0f, indices);
+			for(gint i = 0; i < count; ++i)
+				values[i] = (guint8)((indices[i] * 255 + (CURVE_SIZE - 1) / 2) / (CURVE_SIZE - 1));
+		} break;
+	}
+}
+
+
+static
+void
+_gtk_scalable_image_map_channel(const ImageSource* source,
+                                const guchar*      row,
+                                gint               count,
+                                gint               stride,
+                                gint32* restrict   indices,
+                                guint8* restrict   values)
+{
+	switch(source->format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:
+			_gtk_scalable_image_map_uint8(row, count, stride, source->table, values);
+			break;
+
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16:
+			_gtk_scalable_image_map_uint16((const guint16*)row, count, stride, source->table, values);
+			break;
+
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:
+			_gtk_scalable_image_map_float((const gfloat*)row, count, stride,
+			                              source->low, source->inverse_window, source->curve, indices, values);
+			break;
+	}
+}
+
+
+static
+gsize
+_gtk_scalable_image_get_sample_size(GtkScalableImageFormat format)
+{
+	switch(format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:  return sizeof(guint8);
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16: return sizeof(guint16);
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:  return sizeof(gfloat);
+	}
+	g_assert_not_reached();
+	return 0;
+}
+
+
+/* Converts a rectangle of the source to display-mapped premultiplied CAIRO_FORMAT_ARGB32 pixels.
+ * The rectangle must be inside the image */
+static
+void
+_gtk_scalable_image_convert_rect(const ImageSource*  source,
+                                 const GdkRectangle* rect,
+                                 guchar*             data,
+                                 gint                stride)
+{
+	gint   width        = rect->width;
+	gint   height       = rect->height;
+	gsize  sample_size  = _gtk_scalable_image_get_sample_size(source->format);
+	gint   color_count  = source->has_alpha ? source->n_channels - 1 : source->n_channels;
+	gint   sample_step  = source->n_channels;
+
+	/* One row of display values per channel, plus the float quantization indices */
+	guint8* values  = g_malloc((gsize)width * 4);
+	gint32* indices = g_malloc((gsize)width * sizeof(gint32));
+	guint8* channel[4] = { values, values + width, values + 2 * width, values + 3 * width };
+
+	for(gint y = 0; y < height; ++y)
+	{
+		const guchar* row = source->pixels
+		                  + (gsize)(rect->y + y) * source->rowstride
+		                  + (gsize)rect->x * source->n_channels * sample_size;
+
+		for(gint c = 0; c < color_count; ++c)
+			_gtk_scalable_image_map_channel(source, row + c * sample_size, width, sample_step, indices, channel[c]);
+		if(source->has_alpha)
+			_gtk_scalable_image_map_alpha(source, row + color_count * sample_size, width, sample_step, indices, channel[3]);
+
+		guint32* pixels = (guint32*)(data + (gsize)y * stride);
+		for(gint x = 0; x < width; ++x)
+		{
+			guint r, g, b;
+			if(color_count == 1)
+			{
+				guint32 color = source->lut ? source->lut[channel[0][x]] : channel[0][x] * 0x010101u;
+				r = (color >> 16) & 0xFF;
+				g = (color >>  8) & 0xFF;
+				b =  color        & 0xFF;
+			}
+			else if(source->lut)
+			{
+				r = (source->lut[channel[0][x]] >> 16) & 0xFF;
+				g = (source->lut[channel[1][x]] >>  8) & 0xFF;
+				b =  source->lut[channel[2][x]]        & 0xFF;
+			}
+			else
+			{
+				r = channel[0][x];
+				g = channel[1][x];
+				b = channel[2][x];
+			}
+
+			if(source->has_alpha)
+			{
+				guint a = channel[3][x];
+				guint t;
+				t = r * a + 0x80; r = ((t >> 8) + t) >> 8;
+				t = g * a + 0x80; g = ((t >> 8) + t) >> 8;
+				t = b * a + 0x80; b = ((t >> 8) + t) >> 8;
+				pixels[x] = (a << 24) | (r << 16) | (g << 8) | b;
+			}
+			else
+			{
+				pixels[x] = 0xFF000000u | (r << 16) | (g << 8) | b;
+			}
+		}
+	}
+
+	g_free(indices);
+	g_free(values);
+}
+
+
+/* Runs func(data, index) for every index in [0, count) on up to one thread per CPU.
+ * The calling thread takes part in the work, helped by the threads of a pool shared by all widgets
+ * and created on first use. Indices are claimed through an atomic counter */
+typedef void (*ParallelFunc) (gpointer data, gint index);
+
+typedef struct
+{
+	ParallelFunc func;
+	gpointer     data;
+	gint         count;
+	gint         next;
+
+	/* Helpers that have not returned yet. The job lives on the caller's stack, so it waits for them */
+	gint         pending;
+	GMutex       mutex;
+	GCond        cond;
+} ParallelJob;
+
+
+static
+void
+_gtk_scalable_image_parallel_run(ParallelJob* job)
+{
+	for(;;)
+	{
+		gint index = g_atomic_int_add(&job->next, 1);
+		if(index >= job->count)
+			break;
+		job->func(job->data, index);
+	}
+}
+
+
+static
+void
+_gtk_scalable_image_parallel_helper(gpointer data, gpointer user_data)
+{
+	ParallelJob* job = data;
+	_gtk_scalable_image_parallel_run(job);
+
+	g_mutex_lock(&job->mutex);
+	job->pending -= 1;
+	if(job->pending == 0)
+		g_cond_signal(&job->cond);
+	g_mutex_unlock(&job->mutex);
+}
+
+
+static
+GThreadPool*
+_gtk_scalable_image_get_thread_pool(void)
+{
+	static gsize pool = 0;
+	if(g_once_init_enter(&pool))
+	{
+		gint helper_count = MAX((gint)g_get_num_processors() - 1, 1);
+		GThreadPool* new_pool = g_thread_pool_new(_gtk_scalable_image_parallel_helper, NULL, helper_count, FALSE, NULL);
+		g_once_init_leave(&pool, (gsize)new_pool);
+	}
+	return (GThreadPool*)pool;
+}
+
+
+static
+void
+_gtk_scalable_image_parallel_for(gint count, ParallelFunc func, gpointer data)
+{
+	ParallelJob job = { .func = func, .data = data, .count = count };
+	gint helper_count = MIN((gint)g_get_num_processors(), count) - 1;
+
+	if(helper_count > 0)
+	{
+		GThreadPool* pool = _gtk_scalable_image_get_thread_pool();
+		g_mutex_init(&job.mutex);
+		g_cond_init(&job.cond);
+		job.pending = helper_count;
+		for(gint i = 0; i < helper_count; ++i)
+			g_thread_pool_push(pool, &job, NULL);
+	}
+
+	_gtk_scalable_image_parallel_run(&job);
+
+	if(helper_count > 0)
+	{
+		g_mutex_lock(&job.mutex);
+		while(job.pending > 0)
+			g_cond_wait(&job.cond, &job.mutex);
+		g_mutex_unlock(&job.mutex);
+		g_cond_clear(&job.cond);
+		g_mutex_clear(&job.mutex);
+	}
+}
+
+
+static
+void
+_gtk_scalable_image_mip_free(gpointer data)
+{
+	Mip* mip = data;
+	g_free(mip->pixels);
+	g_slice_free(Mip, mip);
+}
+
+
+static
+double
+_gtk_scalable_image_read_sample(GtkScalableImageFormat format, const guchar* row, gint index)
+{
+	switch(format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:  return ((const guint8*)row)[index];
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16: return ((const guint16*)row)[index];
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:  return ((const gfloat*)row)[index];
+	}
+	return 0.0;
+}
+
+
+static
+void
+_gtk_scalable_image_write_sample(GtkScalableImageFormat format, guchar* row, gint index, double value)
+{
+	switch(format)
+	{
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT8:  ((guint8*)row)[index]  = (guint8)(value + 0.5);  break;
+		case GTK_SCALABLE_IMAGE_FORMAT_UINT16: ((guint16*)row)[index] = (guint16)(value + 0.5); break;
+		case GTK_SCALABLE_IMAGE_FORMAT_FLOAT:  ((gfloat*)row)[index]  = (gfloat)value;          break;
+	}
+}
+
+
+/* Rows of a mip level computed in parallel from the level below */
+#define MIP_ROWS_PER_JOB 32
+
+typedef struct
+{
+	const ImageSource* parent;
+	Mip*               mip;
+} MipJob;
+
+
+/* Averages the 2x2 footprint of each sample, fewer on the odd edges of the parent.
+ * Colors are weighted by alpha so that transparent samples do not bleed into the average */
+static
+void
+_gtk_scalable_image_downsample_rows(gpointer data, gint index)
+{
+	MipJob*                job         = data;
+	const ImageSource*     parent      = job->parent;
+	Mip*                   mip         = job->mip;
+	GtkScalableImageFormat format      = parent->format;
+	gint                   n_channels  = parent->n_channels;
+	gint                   color_count = parent->has_alpha ? n_channels - 1 : n_channels;
+
+	gint first_row = index * MIP_ROWS_PER_JOB;
+	gint last_row  = MIN(first_row + MIP_ROWS_PER_JOB, mip->height);
+	for(gint y = first_row; y < last_row; ++y)
+	{
+		const guchar* rows[2];
+		gint          row_count = MIN(2, parent->height - 2 * y);
+		rows[0] = parent->pixels + (gsize)(2 * y) * parent->rowstride;
+		rows[1] = rows[0] + (row_count > 1 ? parent->rowstride : 0);
+		guchar* out = mip->pixels + (gsize)y * mip->rowstride;
+
+		for(gint x = 0; x < mip->width; ++x)
+		{
+			gint   column_count = MIN(2, parent->width - 2 * x);
+			gint   count        = row_count * column_count;
+			double sums[4]      = { 0.0, 0.0, 0.0, 0.0 };
+			double alpha_sum    = 0.0;
+
+			for(gint j = 0; j < row_count; ++j)
+			{
+				for(gint i = 0; i < column_count; ++i)
+				{
+					gint   sample = (2 * x + i) * n_channels;
+					double alpha  = parent->has_alpha ? _gtk_scalable_image_read_sample(format, rows[j], sample + color_count) : 1.0;
+					for(gint c = 0; c < color_count; ++c)
+						sums[c] += _gtk_scalable_image_read_sample(format, rows[j], sample + c) * alpha;
+					alpha_sum += alpha;
+				}
+			}
+
+			for(gint c = 0; c < color_count; ++c)
+				_gtk_scalable_image_write_sample(format, out, x * n_channels + c, alpha_sum > 0.0 ? sums[c] / alpha_sum : 0.0);
+			if(parent->has_alpha)
+				_gtk_scalable_image_write_sample(format, out, x * n_channels + color_count, alpha_sum / count);
+		}
+	}
+}
+
+
+/* Points source at the copy of the image for the given level, building the missing levels first.
+ * source must describe level 0 */
+static
+void
+_gtk_scalable_image_get_level_source(GtkScalableImage* self, gint level, ImageSource* source)
+{
+	GPtrArray* mips        = self->priv->mips;
+	gsize      sample_size = _gtk_scalable_image_get_sample_size(source->format);
+
+	for(gint l = 1; l <= level; ++l)
+	{
+		if((guint)l > mips->len)
+		{
+			Mip* mip = g_slice_new0(Mip);
+			mip->width     = (source->width  + 1) / 2;
+			mip->height    = (source->height + 1) / 2;
+			mip->rowstride = (gint)(mip->width * source->n_channels * sample_size);
+			mip->pixels    = g_malloc((gsize)mip->rowstride * mip->height);
+
+			MipJob job = { source, mip };
+			_gtk_scalable_image_parallel_for((mip->height + MIP_ROWS_PER_JOB - 1) / MIP_ROWS_PER_JOB,
+			                                 _gtk_scalable_image_downsample_rows, &job);
+			g_ptr_array_add(mips, mip);
+		}
+
+		Mip* mip = g_ptr_array_index(mips, l - 1);
+		source->pixels    = mip->pixels;
+		source->width     = mip->width;
+		source->height    = mip->height;
+		source->rowstride = mip->rowstride;
+	}
+}
+
+
+static
+void
+_gtk_scalable_image_tile_free(gpointer data)
+{
+	Tile* tile = data;
+	cairo_surface_destroy(tile->surface);
+	g_slice_free(Tile, tile);
+}
+
+
+/* Tiles whose display mapping is out of date, remapped in parallel */
+typedef struct
+{
+	const ImageSource* source;
+	Tile**             tiles;
+	GdkRectangle*      rects;
+} TileJob;
+
+
+static
+void
+_gtk_scalable_image_map_tile(gpointer data, gint index)
+{
+	TileJob*         job     = data;
+	cairo_surface_t* surface = job->tiles[index]->surface;
+	cairo_surface_flush(surface);
+	_gtk_scalable_image_convert_rect(job->source, &job->rects[index],
+	                                 cairo_image_surface_get_data(surface),
+	                                 cairo_image_surface_get_stride(surface));
+	cairo_surface_mark_dirty(surface);
+}
+
+
+/* Returns the mip level to draw from when each output pixel covers step source pixels.
+ * The level is the coarsest one that still has at least one pixel per output pixel */
+static
+gint
+_gtk_scalable_image_get_level_for_step(double step)
+{
+	gint level = 0;
+	while(level < MAX_TILE_LEVEL && (2 << level) <= step)
+		++level;
+	return level;
+}
+
+
+/* Draws the image through the display mapping. Only the tiles intersecting the clip area are
+ * mapped, from the coarsest mip level that still has at least one pixel per screen pixel.
+ * Tiles are cached until the display mapping or the source changes.
+ * The context must already be transformed to image space */
+static
+void
+_gtk_scalable_image_draw_tiles(GtkScalableImage* self, cairo_t* context)
+{
+	GtkScalableImagePrivate* priv = self->priv;
+
+	ImageSource source;
+	if(!_gtk_scalable_image_get_source(self, &source))
+		return;
+
+	gint level = _gtk_scalable_image_get_level_for_step(1.0 / self->scale);
+	gint step  = 1 << level;
+	gint span = TILE_SIZE << level;
+
+	double clip_x1, clip_y1, clip_x2, clip_y2;
+	cairo_clip_extents(context, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+	gint first_x = MAX((gint)floor(clip_x1), 0) / span;
+	gint first_y = MAX((gint)floor(clip_y1), 0) / span;
+	gint last_x  = MIN((gint)ceil(clip_x2), source.width)  - 1;
+	gint last_y  = MIN((gint)ceil(clip_y2), source.height) - 1;
+	if(last_x < 0 || last_y < 0)
+		return;
+	last_x /= span;
+	last_y /= span;
+	/* The clip area can lie entirely in the margin around a centered image */
+	if(first_x > last_x || first_y > last_y)
+		return;
+
+	ImageSource level_source = source;
+	_gtk_scalable_image_get_level_source(self, level, &level_source);
+
+	/* Drop the tiles that are not visible before the cache grows past its budget */
+	gint visible_count = (last_x - first_x + 1) * (last_y - first_y + 1);
+	if(g_hash_table_size(priv->tiles) + visible_count > MAX_CACHED_TILES)
+	{
+		GHashTableIter iter;
+		gpointer       key;
+		g_hash_table_iter_init(&iter, priv->tiles);
+		while(g_hash_table_iter_next(&iter, &key, NULL))
+		{
+			guint packed = GPOINTER_TO_UINT(key);
+			guint x = packed & 0x3FFF;
+			guint y = (packed >> 14) & 0x3FFF;
+			if((gint)(packed >> 28) != level || x < (guint)first_x || x > (guint)last_x || y < (guint)first_y || y > (guint)last_y)
+				g_hash_table_iter_remove(&iter);
+		}
+	}
+
+	Tile**        tiles = g_new(Tile*, visible_count);
+	Tile**        stale = g_new(Tile*, visible_count);
+	GdkRectangle* rects = g_new(GdkRectangle, visible_count);
+	gint          stale_count = 0;
+
+	for(gint y = first_y, i = 0; y <= last_y; ++y)
+	{
+		for(gint x = first_x; x <= last_x; ++x, ++i)
+		{
+			/* In level coordinates */
+			GdkRectangle rect = { x * TILE_SIZE, y * TILE_SIZE,
+			                      MIN(TILE_SIZE, level_source.width  - x * TILE_SIZE),
+			                      MIN(TILE_SIZE, level_source.height - y * TILE_SIZE) };
+
+			Tile* tile = g_hash_table_lookup(priv->tiles, TILE_KEY(level, x, y));
+			if(!tile)
+			{
+				tile = g_slice_new0(Tile);
+				tile->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, rect.width, rect.height);
+				tile->version = priv->mapping_version - 1;
+				g_hash_table_insert(priv->tiles, TILE_KEY(level, x, y), tile);
+			}
+			if(tile->version != priv->mapping_version)
+			{
+				tile->version       = priv->mapping_version;
+				stale[stale_count]  = tile;
+				rects[stale_count]  = rect;
+				stale_count        += 1;
+			}
+			tiles[i] = tile;
+		}
+	}
+
+	TileJob job = { &level_source, stale, rects };
+	_gtk_scalable_image_parallel_for(stale_count, _gtk_scalable_image_map_tile, &job);
+
+	/* Pixel aligned edges and padded sources keep the seams between tiles invisible */
+	cairo_save(context);
+	cairo_set_antialias(context, CAIRO_ANTIALIAS_NONE);
+	for(gint y = first_y, i = 0; y <= last_y; ++y)
+	{
+		for(gint x = first_x; x <= last_x; ++x, ++i)
+		{
+			double width  = MIN(span, source.width  - x * span);
+			double height = MIN(span, source.height - y * span);
+			cairo_save(context);
+			cairo_translate(context, x * span, y * span);
+			cairo_scale(context, step, step);
+			cairo_set_source_surface(context, tiles[i]->surface, 0.0, 0.0);
+			cairo_pattern_set_extend(cairo_get_source(context), CAIRO_EXTEND_PAD);
+			cairo_rectangle(context, 0.0, 0.0, width / step, height / step);
+			cairo_fill(context);
+			cairo_restore(context);
+		}
+	}
+	cairo_restore(context);
+
+	g_free(rects);
+	g_free(stale);
+	g_free(tiles);
+}
+
+
+/* Bands of the output of gtk_scalable_image_render_region(), rendered in parallel.
+ * source is the mip level that matches the scale, and the region origin and steps are in its pixels */
+typedef struct
+{
+	ImageSource       source;
+	double            x;
+	double            y;
+	double            step_x;
+	double            step_y;
+	gint              width;
+	gint              height;
+	gint              first_band;
+	cairo_surface_t** bands;
+	gint              failed;
+} RenderJob;
+
+
+/* Prepares job to render the image-space rectangle region scaled to width x height pixels.
+ * The mip level is built here, on the calling thread. Returns FALSE if there is no image */
+static
+gboolean
+_gtk_scalable_image_init_render_job(GtkScalableImage*   self,
+                                    RenderJob*          job,
+                                    const GdkRectangle* region,
+                                    gint                width,
+                                    gint                height)
+{
+	if(!_gtk_scalable_image_get_source(self, &job->source))
+		return FALSE;
+
+	double step_x = (double)region->width  / (double)width;
+	double step_y = (double)region->height / (double)height;
+	gint   level  = _gtk_scalable_image_get_level_for_step(MIN(step_x, step_y));
+	double factor = (double)(1 << level);
+	_gtk_scalable_image_get_level_source(self, level, &job->source);
+
+	job->x          = region->x / factor;
+	job->y          = region->y / factor;
+	job->step_x     = step_x / factor;
+	job->step_y     = step_y / factor;
+	job->width      = width;
+	job->height     = height;
+	job->first_band = 0;
+	job->bands      = NULL;
+	job->failed     = FALSE;
+	return TRUE;
+}
+
+
+/* Renders one band of the output. The band is split in chunks that each convert at most RENDER_CHUNK_SIZE
+ * source pixels a side, plus a margin for the filter footprint, so memory does not grow with the region.
+ * Sets job->failed if a chunk cannot be allocated */
+static
+void
+_gtk_scalable_image_render_band(gpointer data, gint index)
+{
+	RenderJob*       job  = data;
+	cairo_surface_t* band = job->bands[index];
+	gint band_y      = (job->first_band + index) * RENDER_BAND_HEIGHT;
+	gint band_height = cairo_image_surface_get_height(band);
+
+	gint margin       = (gint)ceil(MAX(job->step_x, job->step_y)) + 2;
+	gint chunk_width  = MAX(1, (gint)(RENDER_CHUNK_SIZE / job->step_x));
+	gint chunk_height = MAX(1, (gint)(RENDER_CHUNK_SIZE / job->step_y));
+
+	GdkRectangle image_rect = { 0, 0, job->source.width, job->source.height };
+	gboolean     failed     = FALSE;
+	cairo_t*     context    = cairo_create(band);
+	for(gint chunk_y = band_y; !failed && chunk_y < band_y + band_height; chunk_y += chunk_height)
+	{
+		for(gint chunk_x = 0; !failed && chunk_x < job->width; chunk_x += chunk_width)
+		{
+			GdkRectangle output_rect = { chunk_x, chunk_y,
+			                             MIN(chunk_width, job->width - chunk_x),
+			                             MIN(chunk_height, band_y + band_height - chunk_y) };
+
+			GdkRectangle needed_rect;
+			needed_rect.x      = (gint)floor(job->x + output_rect.x * job->step_x) - margin;
+			needed_rect.y      = (gint)floor(job->y + output_rect.y * job->step_y) - margin;
+			needed_rect.width  = (gint)ceil(output_rect.width  * job->step_x) + 2 * margin;
+			needed_rect.height = (gint)ceil(output_rect.height * job->step_y) + 2 * margin;
+
+			GdkRectangle source_rect;
+			if(!gdk_rectangle_intersect(&image_rect, &needed_rect, &source_rect))
+				continue;
+
+			cairo_surface_t* source = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, source_rect.width, source_rect.height);
+			if(cairo_surface_status(source) != CAIRO_STATUS_SUCCESS)
+			{
+				failed = TRUE;
+			}
+			else
+			{
+				cairo_surface_flush(source);
+				_gtk_scalable_image_convert_rect(&job->source, &source_rect,
+				                                 cairo_image_surface_get_data(source),
+				                                 cairo_image_surface_get_stride(source));
+				cairo_surface_mark_dirty(source);
+
+				/* The margin keeps the filter from seeing the edges of the chunk, and the clip keeps
+				 * the chunks from overlapping */
+				cairo_save(context);
+				cairo_rectangle(context, output_rect.x, output_rect.y - band_y, output_rect.width, output_rect.height);
+				cairo_clip(context);
+				cairo_translate(context, 0.0, -band_y);
+				cairo_scale(context, 1.0 / job->step_x, 1.0 / job->step_y);
+				cairo_translate(context, -job->x, -job->y);
+				cairo_set_source_surface(context, source, source_rect.x, source_rect.y);
+				cairo_paint(context);
+				cairo_restore(context);
+			}
+			cairo_surface_destroy(source);
+		}
+	}
+	if(cairo_status(context) != CAIRO_STATUS_SUCCESS)
+		failed = TRUE;
+	cairo_destroy(context);
+	cairo_surface_flush(band);
+
+	if(failed)
+		g_atomic_int_set(&job->failed, TRUE);
+}
+
+
+
+static
+void
+_gtk_scalable_image_overlay_free(gpointer data)
+{
+	Overlay* overlay = data;
+	g_free(overlay->points);
+	g_slice_free(Overlay, overlay);
+}
+
+
+/* Overlays are sorted by id, so an id is found by binary search. Returns -1 if there is none.
+ * Removed overlays are still found */
+static
+gint
+_gtk_scalable_image_find_overlay(GtkScalableImage* self, guint id)
+{
+	GPtrArray* overlays = self->priv->overlays;
+	gint low  = 0;
+	gint high = (gint)overlays->len - 1;
+	while(low <= high)
+	{
+		gint     middle  = (low + high) / 2;
+		Overlay* overlay = g_ptr_array_index(overlays, middle);
+		if(overlay->id == id)
+			return middle;
+		if(overlay->id < id)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+	return -1;
+}
+
+
+static
+int
+_gtk_scalable_image_compare_box_x(const void* a, const void* b)
+{
+	const OverlayBox* box_a = a;
+	const OverlayBox* box_b = b;
+	double center_a = box_a->x1 + box_a->x2;
+	double center_b = box_b->x1 + box_b->x2;
+	return (center_a > center_b) - (center_a < center_b);
+}
+
+
+static
+int
+_gtk_scalable_image_compare_box_y(const void* a, const void* b)
+{
+	const OverlayBox* box_a = a;
+	const OverlayBox* box_b = b;
+	double center_a = box_a->y1 + box_a->y2;
+	double center_b = box_b->y1 + box_b->y2;
+	return (center_a > center_b) - (center_a < center_b);
+}
+
+
+/* Sort-Tile-Recursive ordering: vertical slices by x, then runs of OVERLAY_NODE_CAPACITY boxes by y
+ * inside each slice, so that consecutive boxes are spatially close */
+static
+void
+_gtk_scalable_image_sort_boxes(OverlayBox* boxes, gint count)
+{
+	gint node_count  = (count + OVERLAY_NODE_CAPACITY - 1) / OVERLAY_NODE_CAPACITY;
+	gint slice_count = (gint)ceil(sqrt(node_count));
+	gint slice_size  = slice_count * OVERLAY_NODE_CAPACITY;
+
+	qsort(boxes, count, sizeof(OverlayBox), _gtk_scalable_image_compare_box_x);
+	for(gint i = 0; i < count; i += slice_size)
+		qsort(boxes + i, MIN(slice_size, count - i), sizeof(OverlayBox), _gtk_scalable_image_compare_box_y);
+}
+
+
+static
+void
+_gtk_scalable_image_overlay_tree_clear(gpointer data)
+{
+	OverlayTree* tree = data;
+	g_array_unref(tree->boxes);
+}
+
+
+/* Bulk loads an R-tree over count overlays starting at first */
+static
+OverlayTree
+_gtk_scalable_image_build_overlay_tree(GtkScalableImage* self, gint first, gint count)
+{
+	OverlayTree tree  = { first, count, g_array_sized_new(FALSE, FALSE, sizeof(OverlayBox), count + count / (OVERLAY_NODE_CAPACITY - 1) + 1) };
+	GArray*     boxes = tree.boxes;
+
+	for(gint i = first; i < first + count; ++i)
+	{
+		Overlay*   overlay = g_ptr_array_index(self->priv->overlays, i);
+		OverlayBox box     = { overlay->x1, overlay->y1, overlay->x2, overlay->y2, i, 0 };
+		g_array_append_val(boxes, box);
+	}
+
+	gint level_start = 0;
+	gint level_count = count;
+	while(level_count > 1)
+	{
+		_gtk_scalable_image_sort_boxes(&g_array_index(boxes, OverlayBox, level_start), level_count);
+
+		gint next_start = (gint)boxes->len;
+		for(gint i = 0; i < level_count; i += OVERLAY_NODE_CAPACITY)
+		{
+			OverlayBox node = g_array_index(boxes, OverlayBox, level_start + i);
+			node.first = level_start + i;
+			node.count = MIN(OVERLAY_NODE_CAPACITY, level_count - i);
+			for(gint j = 1; j < node.count; ++j)
+			{
+				OverlayBox* child = &g_array_index(boxes, OverlayBox, node.first + j);
+				node.x1 = MIN(node.x1, child->x1);
+				node.y1 = MIN(node.y1, child->y1);
+				node.x2 = MAX(node.x2, child->x2);
+				node.y2 = MAX(node.y2, child->y2);
+			}
+			g_array_append_val(boxes, node);
+		}
+		level_start = next_start;
+		level_count = (gint)boxes->len - next_start;
+	}
+	return tree;
+}
+
+
+/* Indexes the overlays added since the last call once there are OVERLAY_NODE_CAPACITY of them.
+ * The newest trees that are not larger than the new one are merged into it, like the carries of a binary counter.
+ * So there are O(log n) trees and each overlay is sorted into a new tree O(log n) times,
+ * which makes an addition amortized O(log² n). A single addition can still rebuild every tree */
+static
+void
+_gtk_scalable_image_index_new_overlays(GtkScalableImage* self)
+{
+	GtkScalableImagePrivate* priv  = self->priv;
+	GArray*                  trees = priv->overlay_trees;
+
+	gint first = priv->overlay_indexed_count;
+	gint count = (gint)priv->overlays->len - first;
+	if(count < OVERLAY_NODE_CAPACITY)
+		return;
+
+	while(trees->len > 0 && g_array_index(trees, OverlayTree, trees->len - 1).count <= count)
+	{
+		first  = g_array_index(trees, OverlayTree, trees->len - 1).first;
+		count += g_array_index(trees, OverlayTree, trees->len - 1).count;
+		g_array_remove_index(trees, trees->len - 1);
+	}
+
+	OverlayTree tree = _gtk_scalable_image_build_overlay_tree(self, first, count);
+	g_array_append_val(trees, tree);
+	priv->overlay_indexed_count = first + count;
+}
+
+
+/* Frees the removed overlays once they are more than half of all, and indexes the rest in a single tree.
+ * At least n / 2 removals pay for each O(n log n) rebuild, so a removal is amortized O(log n) */
+static
+void
+_gtk_scalable_image_compact_overlays(GtkScalableImage* self)
+{
+	GtkScalableImagePrivate* priv     = self->priv;
+	GPtrArray*               overlays = priv->overlays;
+
+	if(priv->overlay_removed_count * 2 <= (gint)overlays->len)
+		return;
+
+	guint kept = 0;
+	for(guint i = 0; i < overlays->len; ++i)
+	{
+		Overlay* overlay = g_ptr_array_index(overlays, i);
+		if(overlay->removed)
+			_gtk_scalable_image_overlay_free(overlay);
+		else
+			overlays->pdata[kept++] = overlay;
+	}
+	/* The slots past kept hold stale pointers, which must not be freed again */
+	g_ptr_array_set_free_func(overlays, NULL);
+	g_ptr_array_set_size(overlays, kept);
+	g_ptr_array_set_free_func(overlays, _gtk_scalable_image_overlay_free);
+
+	g_array_set_size(priv->overlay_trees, 0);
+	priv->overlay_indexed_count = 0;
+	priv->overlay_removed_count = 0;
+	if(kept > 0)
+	{
+		OverlayTree tree = _gtk_scalable_image_build_overlay_tree(self, 0, (gint)kept);
+		g_array_append_val(priv->overlay_trees, tree);
+		priv->overlay_indexed_count = (gint)kept;
+	}
+}
+
+
+static
+void
+_gtk_scalable_image_query_overlay_tree(GtkScalableImage*  self,
+                                       const OverlayTree* tree,
+                                       gint               box_index,
+                                       double             x1,
+                                       double             y1,
+                                       double             x2,
+                                       double             y2,
+                                       GArray*            result)
+{
+	OverlayBox* box = &g_array_index(tree->boxes, OverlayBox, box_index);
+	if(box->x1 > x2 || box->x2 < x1 || box->y1 > y2 || box->y2 < y1)
+		return;
+
+	if(box->count == 0)
+	{
+		Overlay* overlay = g_ptr_array_index(self->priv->overlays, box->first);
+		if(!overlay->removed)
+			g_array_append_val(result, box->first);
+		return;
+	}
+
+	for(gint i = 0; i < box->count; ++i)
+		_gtk_scalable_image_query_overlay_tree(self, tree, box->first + i, x1, y1, x2, y2, result);
+}
+
+
+/* Appends to result the indices in priv->overlays of the overlays whose bounds intersect the rectangle,
+ * in no particular order */
+static
+void
+_gtk_scalable_image_query_overlays(GtkScalableImage* self,
+                                   double            x1,
+                                   double            y1,
+                                   double            x2,
+                                   double            y2,
+                                   GArray*           result)
+{
+	GtkScalableImagePrivate* priv = self->priv;
+
+	for(guint i = 0; i < priv->overlay_trees->len; ++i)
+	{
+		const OverlayTree* tree = &g_array_index(priv->overlay_trees, OverlayTree, i);
+		_gtk_scalable_image_query_overlay_tree(self, tree, (gint)tree->boxes->len - 1, x1, y1, x2, y2, result);
+	}
+
+	for(gint i = priv->overlay_indexed_count; i < (gint)priv->overlays->len; ++i)
+	{
+		Overlay* overlay = g_ptr_array_index(priv->overlays, i);
+		if(!overlay->removed && overlay->x1 <= x2 && overlay->x2 >= x1 && overlay->y1 <= y2 && overlay->y2 >= y1)
+			g_array_append_val(result, i);
+	}
+}
+
+
+static
+gint
+_gtk_scalable_image_compare_int(gconstpointer a, gconstpointer b)
+{
+	return *(const gint*)a - *(const gint*)b;
+}
+
+
+/* Even-odd rule, the same cairo uses to fill */
+static
+gboolean
+_gtk_scalable_image_overlay_contains(Overlay* overlay, double x, double y)
+{
+	if(x < overlay->x1 || x > overlay->x2 || y < overlay->y1 || y > overlay->y2)
+		return FALSE;
+	if(!overlay->points)
+		return TRUE;
+
+	gboolean inside = FALSE;
+	for(gint i = 0, j = overlay->n_points - 1; i < overlay->n_points; j = i++)
+	{
+		double xi = overlay->points[2 * i], yi = overlay->points[2 * i + 1];
+		double xj = overlay->points[2 * j], yj = overlay->points[2 * j + 1];
+		if((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+			inside = !inside;
+	}
+	return inside;
+}
+
+
+/* Draws the overlays that intersect the clip area, in insertion order.
+ * Shapes that would be a few pixels on screen are drawn as a filled box, and polygon vertices
+ * closer than a pixel to the previous one are skipped. The context must already be transformed to image space */
+static
+void
+_gtk_scalable_image_draw_overlays(GtkScalableImage* self, cairo_t* context)
+{
+	if(self->priv->overlays->len == 0)
+		return;
+
+	double clip_x1, clip_y1, clip_x2, clip_y2;
+	cairo_clip_extents(context, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+
+	/* Outlines straddle the shape bounds */
+	double pixel = 1.0 / self->scale;
+	double grow  = OVERLAY_LINE_WIDTH * pixel;
+	GArray* visible = g_array_new(FALSE, FALSE, sizeof(gint));
+	_gtk_scalable_image_query_overlays(self, clip_x1 - grow, clip_y1 - grow, clip_x2 + grow, clip_y2 + grow, visible);
+	g_array_sort(visible, _gtk_scalable_image_compare_int);
+
+	cairo_save(context);
+	cairo_set_line_width(context, OVERLAY_LINE_WIDTH * pixel);
+	double lod_size = OVERLAY_LOD_SIZE * pixel;
+	for(guint i = 0; i < visible->len; ++i)
+	{
+		Overlay* overlay = g_ptr_array_index(self->priv->overlays, g_array_index(visible, gint, i));
+		gdk_cairo_set_source_rgba(context, &overlay->color);
+
+		if(overlay->x2 - overlay->x1 < lod_size && overlay->y2 - overlay->y1 < lod_size)
+		{
+			cairo_rectangle(context, overlay->x1, overlay->y1,
+			                MAX(overlay->x2 - overlay->x1, pixel), MAX(overlay->y2 - overlay->y1, pixel));
+			cairo_fill(context);
+		}
+		else if(!overlay->points)
+		{
+			cairo_rectangle(context, overlay->x1, overlay->y1, overlay->x2 - overlay->x1, overlay->y2 - overlay->y1);
+			cairo_stroke(context);
+		}
+		else
+		{
+			double last_x = overlay->points[0];
+			double last_y = overlay->points[1];
+			cairo_move_to(context, last_x, last_y);
+			for(gint j = 1; j < overlay->n_points; ++j)
+			{
+				double x = overlay->points[2 * j];
+				double y = overlay->points[2 * j + 1];
+				if(j == overlay->n_points - 1 || fabs(x - last_x) >= pixel || fabs(y - last_y) >= pixel)
+				{
+					cairo_line_to(context, x, y);
+					last_x = x;
+					last_y = y;
+				}
+			}
+			cairo_close_path(context);
+			cairo_stroke(context);
+		}
+	}
+	cairo_restore(context);
+
+	g_array_free(visible, TRUE);
+}
@@ -1,3 +1,6 @@
+#include <math.h>
+#include <string.h>
+
 #include "gtkscalableimage.h"
 #include "gtkscalableimage-private.c"
 
@@ -38,7 +41,7 @@ gtk_scalable_image_set_scale(GtkScalableImage* self, double scale)
 /* Computing this was hell because I suck at math 
  * http://stackoverflow.com/questions/2916081/zoom-in-on-a-point-using-scale-and-translate */
 void
-gtk_scalable_imagevv_set_scale_at_point(GtkScalableImage* self, double scale, gint x_vspace, gint y_vspace)
+gtk_scalable_image_set_scale_at_point(GtkScalableImage* self, double scale, gint x_vspace, gint y_vspace)
 {
 	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
 
@@ -71,7 +74,7 @@ gtk_scalable_image_set_scale_to_fit(GtkScalableImage* self)
 	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
 	
 	self->is_fitting = TRUE;
-	if(self->pixbuf)
+	if(_gtk_scalable_image_has_image(self))
 	{
 		// TODO: Compute appropriate scale and assign to self
 		Size image_natural_size = _gtk_scalable_image_get_natural_size(self);
@@ -100,16 +103,23 @@ gtk_scalable_image_get_pixbuf(GtkScalableImage* self)
 }
 
 
+/* Replaces the image, including one set with gtk_scalable_image_set_data(). NULL clears it.
+ * The window is reset to the full 8 bit range, discarding the one set with gtk_scalable_image_set_window_level() */
 void
 gtk_scalable_image_set_pixbuf(GtkScalableImage* self, GdkPixbuf* pixbuf)
 {
 	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
 
-	if(self->pixbuf != pixbuf)
+	if(self->pixbuf != pixbuf || self->priv->data)
 	{
 		if(self->pixbuf)
 			g_object_unref(self->pixbuf);
 		self->pixbuf = pixbuf;
+		g_clear_pointer(&self->priv->data, g_bytes_unref);
+		g_hash_table_remove_all(self->priv->tiles);
+		g_ptr_array_set_size(self->priv->mips, 0);
+		_gtk_scalable_image_reset_window(self);
+		_gtk_scalable_image_update_mapping(self);
 		
 		if(self->pixbuf)
 		{
@@ -139,12 +149,206 @@ gtk_scalable_image_set_pixbuf(GtkScalableImage* self, GdkPixbuf* pixbuf)
 }
 
 
+/* Sets a high bit depth image, replacing the pixbuf. Samples are interleaved in native byte order:
+ * 1 channel is grey, 2 grey and alpha, 3 RGB and 4 RGBA. rowstride is in bytes.
+ * Color channels go through the display mapping, alpha is scaled to 8 bits
+ * (float alpha is expected to be in [0, 1]).
+ * The window is reset to the full range of the format ([0, 1] for float) */
+void
+gtk_scalable_image_set_data(GtkScalableImage*      self,
+                            GBytes*                data,
+                            GtkScalableImageFormat format,
+                            gint                   n_channels,
+                            gint                   width,
+                            gint                   height,
+                            gint                   rowstride)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	g_return_if_fail(data != NULL);
+	g_return_if_fail(n_channels >= 1 && n_channels <= 4);
+	g_return_if_fail(width > 0 && height > 0);
+	g_return_if_fail(format <= GTK_SCALABLE_IMAGE_FORMAT_FLOAT);
+	g_return_if_fail(rowstride > 0);
+
+	gsize sample_size = _gtk_scalable_image_get_sample_size(format);
+	gsize row_size    = (gsize)width * n_channels * sample_size;
+	g_return_if_fail((gsize)rowstride >= row_size);
+	g_return_if_fail(rowstride % sample_size == 0);
+	g_return_if_fail(g_bytes_get_size(data) >= (gsize)rowstride * (height - 1) + row_size);
+
+	GtkScalableImagePrivate* priv = self->priv;
+	g_bytes_ref(data);
+	if(priv->data)
+		g_bytes_unref(priv->data);
+	if(self->pixbuf)
+	{
+		g_object_unref(self->pixbuf);
+		self->pixbuf = NULL;
+	}
+
+	priv->data       = data;
+	priv->format     = format;
+	priv->n_channels = n_channels;
+	priv->width      = width;
+	priv->height     = height;
+	priv->rowstride  = rowstride;
+	g_hash_table_remove_all(priv->tiles);
+	g_ptr_array_set_size(priv->mips, 0);
+	_gtk_scalable_image_reset_window(self);
+	_gtk_scalable_image_update_mapping(self);
+
+	if(gtk_widget_get_realized(GTK_WIDGET(self)))
+	{
+		_gtk_scalable_image_reset_adjustments(self);
+	}
+	gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+
+GBytes*
+gtk_scalable_image_get_data(GtkScalableImage* self)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), NULL);
+	return self->priv->data;
+}
+
+
+/* The window is the range of sample values spread over the display range, the level is its center.
+ * Samples below the window are black, samples above it are white */
+void
+gtk_scalable_image_set_window_level(GtkScalableImage* self, double window, double level)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	g_return_if_fail(window > 0.0);
+
+	if(self->priv->window != window || self->priv->level != level)
+	{
+		self->priv->window = window;
+		self->priv->level  = level;
+		_gtk_scalable_image_update_mapping(self);
+		gtk_widget_queue_draw(GTK_WIDGET(self));
+	}
+}
+
+
+void
+gtk_scalable_image_get_window_level(GtkScalableImage* self, double* window, double* level)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	if(window)
+		*window = self->priv->window;
+	if(level)
+		*level = self->priv->level;
+}
+
+
+double
+gtk_scalable_image_get_brightness(GtkScalableImage* self)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 0.0);
+	return self->priv->brightness;
+}
+
+
+/* Brightness is added to the windowed value, -1.0 makes everything black and 1.0 everything white */
+void
+gtk_scalable_image_set_brightness(GtkScalableImage* self, double brightness)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	g_return_if_fail(brightness >= -1.0 && brightness <= 1.0);
+
+	if(self->priv->brightness != brightness)
+	{
+		self->priv->brightness = brightness;
+		_gtk_scalable_image_update_mapping(self);
+		gtk_widget_queue_draw(GTK_WIDGET(self));
+		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_BRIGHTNESS]);
+	}
+}
+
+
+double
+gtk_scalable_image_get_contrast(GtkScalableImage* self)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 1.0);
+	return self->priv->contrast;
+}
+
+
+/* Contrast scales the windowed value around mid-grey, 0.0 makes everything grey */
+void
+gtk_scalable_image_set_contrast(GtkScalableImage* self, double contrast)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	g_return_if_fail(contrast >= 0.0);
+
+	if(self->priv->contrast != contrast)
+	{
+		self->priv->contrast = contrast;
+		_gtk_scalable_image_update_mapping(self);
+		gtk_widget_queue_draw(GTK_WIDGET(self));
+		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_CONTRAST]);
+	}
+}
+
+
+double
+gtk_scalable_image_get_gamma(GtkScalableImage* self)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 1.0);
+	return self->priv->gamma;
+}
+
+
+void
+gtk_scalable_image_set_gamma(GtkScalableImage* self, double gamma)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+	g_return_if_fail(gamma > 0.0);
+
+	if(self->priv->gamma != gamma)
+	{
+		self->priv->gamma = gamma;
+		_gtk_scalable_image_update_mapping(self);
+		gtk_widget_queue_draw(GTK_WIDGET(self));
+		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_GAMMA]);
+	}
+}
+
+
+const guint32*
+gtk_scalable_image_get_lut(GtkScalableImage* self)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), NULL);
+	return self->priv->lut;
+}
+
+
+/* Sets a color lookup table of 256 0xRRGGBB entries applied after the window and gamma.
+ * Grey images take the whole color from the table, RGB images look up each channel separately.
+ * The table is copied. NULL disables it */
+void
+gtk_scalable_image_set_lut(GtkScalableImage* self, const guint32* lut)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+
+	g_clear_pointer(&self->priv->lut, g_free);
+	if(lut)
+	{
+		self->priv->lut = g_new(guint32, 256);
+		memcpy(self->priv->lut, lut, 256 * sizeof(guint32));
+	}
+	_gtk_scalable_image_update_mapping(self);
+	gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+
 void
 gtk_scalable_image_translate(GtkScalableImage* self, gint delta_x, gint delta_y)
 {
 	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
 	
-	if(self->pixbuf)
+	if(_gtk_scalable_image_has_image(self))
 	{
 		Size image_size  = _gtk_scalable_image_get_natural_size(self);
 
@@ -178,6 +382,260 @@ gtk_scalable_image_translate(GtkScalableImage* self, gint delta_x, gint delta_y)
 }
 
 
+/* Adds a rectangle outline in image coordinates. Returns its id, which is never 0 */
+guint
+gtk_scalable_image_add_rectangle(GtkScalableImage* self,
+                                 double            x,
+                                 double            y,
+                                 double            width,
+                                 double            height,
+                                 const GdkRGBA*    color)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 0);
+	g_return_val_if_fail(width >= 0.0 && height >= 0.0, 0);
+	g_return_val_if_fail(color != NULL, 0);
+
+	Overlay* overlay = g_slice_new0(Overlay);
+	overlay->id    = ++self->priv->next_overlay_id;
+	overlay->color = *color;
+	overlay->x1    = x;
+	overlay->y1    = y;
+	overlay->x2    = x + width;
+	overlay->y2    = y + height;
+	g_ptr_array_add(self->priv->overlays, overlay);
+	_gtk_scalable_image_index_new_overlays(self);
+
+	gtk_widget_queue_draw(GTK_WIDGET(self));
+	return overlay->id;
+}
+
+
+/* Adds a closed polygon outline in image coordinates. points holds n_points (x, y) pairs and is copied.
+ * Returns its id, which is never 0 */
+guint
+gtk_scalable_image_add_polygon(GtkScalableImage* self,
+                               const double*     points,
+                               gint              n_points,
+                               const GdkRGBA*    color)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 0);
+	g_return_val_if_fail(points != NULL, 0);
+	g_return_val_if_fail(n_points >= 2, 0);
+	g_return_val_if_fail(color != NULL, 0);
+
+	Overlay* overlay = g_slice_new0(Overlay);
+	overlay->id       = ++self->priv->next_overlay_id;
+	overlay->color    = *color;
+	overlay->n_points = n_points;
+	overlay->points   = g_new(double, 2 * n_points);
+	memcpy(overlay->points, points, 2 * n_points * sizeof(double));
+	overlay->x1       = overlay->x2 = points[0];
+	overlay->y1       = overlay->y2 = points[1];
+	for(gint i = 1; i < n_points; ++i)
+	{
+		overlay->x1 = MIN(overlay->x1, points[2 * i]);
+		overlay->y1 = MIN(overlay->y1, points[2 * i + 1]);
+		overlay->x2 = MAX(overlay->x2, points[2 * i]);
+		overlay->y2 = MAX(overlay->y2, points[2 * i + 1]);
+	}
+	g_ptr_array_add(self->priv->overlays, overlay);
+	_gtk_scalable_image_index_new_overlays(self);
+
+	gtk_widget_queue_draw(GTK_WIDGET(self));
+	return overlay->id;
+}
+
+
+void
+gtk_scalable_image_remove_overlay(GtkScalableImage* self, guint id)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+
+	gint index = _gtk_scalable_image_find_overlay(self, id);
+	if(index >= 0)
+	{
+		Overlay* overlay = g_ptr_array_index(self->priv->overlays, index);
+		if(!overlay->removed)
+		{
+			overlay->removed = TRUE;
+			self->priv->overlay_removed_count += 1;
+			_gtk_scalable_image_compact_overlays(self);
+			gtk_widget_queue_draw(GTK_WIDGET(self));
+		}
+	}
+}
+
+
+void
+gtk_scalable_image_clear_overlays(GtkScalableImage* self)
+{
+	g_return_if_fail(GTK_IS_SCALABLE_IMAGE(self));
+
+	if(self->priv->overlays->len > 0)
+	{
+		g_ptr_array_set_size(self->priv->overlays, 0);
+		g_array_set_size(self->priv->overlay_trees, 0);
+		self->priv->overlay_indexed_count = 0;
+		self->priv->overlay_removed_count = 0;
+		gtk_widget_queue_draw(GTK_WIDGET(self));
+	}
+}
+
+
+/* Returns the id of the topmost overlay under a point in widget coordinates, or 0 if there is none.
+ * Rectangles are hit anywhere inside, polygons follow the even-odd rule */
+guint
+gtk_scalable_image_get_overlay_at_point(GtkScalableImage* self, gint viewport_x, gint viewport_y)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), 0);
+
+	if(self->priv->overlays->len == 0)
+		return 0;
+
+	double x = self->viewport.x + viewport_x / self->scale;
+	double y = self->viewport.y + viewport_y / self->scale;
+	GArray* hits = g_array_new(FALSE, FALSE, sizeof(gint));
+	_gtk_scalable_image_query_overlays(self, x, y, x, y, hits);
+
+	guint result = 0;
+	gint  top    = -1;
+	for(guint i = 0; i < hits->len; ++i)
+	{
+		gint     index   = g_array_index(hits, gint, i);
+		Overlay* overlay = g_ptr_array_index(self->priv->overlays, index);
+		if(index > top && _gtk_scalable_image_overlay_contains(overlay, x, y))
+		{
+			top    = index;
+			result = overlay->id;
+		}
+	}
+
+	g_array_free(hits, TRUE);
+	return result;
+}
+
+
+/* Renders the image-space rectangle region scaled to width x height pixels.
+ * Does not need the widget to be realized or allocated. Areas of region outside the image are transparent.
+ * The output is split in horizontal bands that are rendered in parallel from the matching mip level.
+ * Returns a new CAIRO_FORMAT_ARGB32 image surface, or NULL if there is no image or the output or
+ * the intermediate surfaces cannot be allocated */
+cairo_surface_t*
+gtk_scalable_image_render_region(GtkScalableImage*   self,
+                                 const GdkRectangle* region,
+                                 gint                width,
+                                 gint                height)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), NULL);
+	g_return_val_if_fail(region != NULL, NULL);
+	g_return_val_if_fail(region->width > 0 && region->height > 0, NULL);
+	g_return_val_if_fail(width > 0 && height > 0, NULL);
+
+	RenderJob job;
+	if(!_gtk_scalable_image_init_render_job(self, &job, region, width, height))
+		return NULL;
+
+	cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	gint band_count = (height + RENDER_BAND_HEIGHT - 1) / RENDER_BAND_HEIGHT;
+	job.bands       = g_new(cairo_surface_t*, band_count);
+
+	/* The bands are views into the rows of the output surface */
+	cairo_surface_flush(surface);
+	guchar* data   = cairo_image_surface_get_data(surface);
+	gint    stride = cairo_image_surface_get_stride(surface);
+	for(gint i = 0; i < band_count; ++i)
+	{
+		gint band_y = i * RENDER_BAND_HEIGHT;
+		job.bands[i] = cairo_image_surface_create_for_data(data + (gsize)band_y * stride,
+		                                                   CAIRO_FORMAT_ARGB32,
+		                                                   width,
+		                                                   MIN(RENDER_BAND_HEIGHT, height - band_y),
+		                                                   stride);
+	}
+
+	_gtk_scalable_image_parallel_for(band_count, _gtk_scalable_image_render_band, &job);
+
+	for(gint i = 0; i < band_count; ++i)
+		cairo_surface_destroy(job.bands[i]);
+	g_free(job.bands);
+
+	if(job.failed)
+	{
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	cairo_surface_mark_dirty(surface);
+	return surface;
+}
+
+
+/* Same as gtk_scalable_image_render_region(), but the output is never held in memory as a whole.
+ * Bands are rendered in parallel batches and passed to func in top to bottom order, along with
+ * their vertical offset in the output. func must not keep a reference to the band.
+ * Rendering stops when func returns FALSE, or when a band cannot be allocated, in which case
+ * the bands of its batch are not passed to func.
+ * Returns TRUE if all bands were rendered and accepted by func */
+gboolean
+gtk_scalable_image_render_region_banded(GtkScalableImage*        self,
+                                        const GdkRectangle*      region,
+                                        gint                     width,
+                                        gint                     height,
+                                        GtkScalableImageBandFunc func,
+                                        gpointer                 user_data)
+{
+	g_return_val_if_fail(GTK_IS_SCALABLE_IMAGE(self), FALSE);
+	g_return_val_if_fail(region != NULL, FALSE);
+	g_return_val_if_fail(region->width > 0 && region->height > 0, FALSE);
+	g_return_val_if_fail(width > 0 && height > 0, FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	RenderJob job;
+	if(!_gtk_scalable_image_init_render_job(self, &job, region, width, height))
+		return FALSE;
+
+	gint total_band_count = (height + RENDER_BAND_HEIGHT - 1) / RENDER_BAND_HEIGHT;
+	gint batch_size       = MIN((gint)g_get_num_processors(), total_band_count);
+	job.bands             = g_new(cairo_surface_t*, batch_size);
+
+	gboolean result = TRUE;
+	for(job.first_band = 0; result && job.first_band < total_band_count; job.first_band += batch_size)
+	{
+		gint band_count = MIN(batch_size, total_band_count - job.first_band);
+		for(gint i = 0; i < band_count; ++i)
+		{
+			gint band_y = (job.first_band + i) * RENDER_BAND_HEIGHT;
+			job.bands[i] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, MIN(RENDER_BAND_HEIGHT, height - band_y));
+			if(cairo_surface_status(job.bands[i]) != CAIRO_STATUS_SUCCESS)
+				job.failed = TRUE;
+		}
+
+		if(!job.failed)
+			_gtk_scalable_image_parallel_for(band_count, _gtk_scalable_image_render_band, &job);
+		if(job.failed)
+			result = FALSE;
+
+		for(gint i = 0; i < band_count; ++i)
+		{
+			if(result)
+			{
+				cairo_surface_mark_dirty(job.bands[i]);
+				result = func(job.bands[i], (job.first_band + i) * RENDER_BAND_HEIGHT, user_data);
+			}
+			cairo_surface_destroy(job.bands[i]);
+		}
+	}
+
+	g_free(job.bands);
+	return result;
+}
+
+
 static
 void
 gtk_scalable_image_on_signal_adjustment_value_changed(GtkAdjustment*    adjustment,
@@ -347,14 +805,22 @@ gtk_scalable_image_draw(GtkWidget* widget, cairo_t* context)
 	// g_debug("------------------------------------------------------------");
 	GtkScalableImage* self = GTK_SCALABLE_IMAGE(widget);
 
-	if(!self->pixbuf)
+	if(!_gtk_scalable_image_has_image(self))
 		return FALSE;
 
 	cairo_save(context);
 	cairo_scale(context, self->scale, self->scale);
 	cairo_translate(context, -self->viewport.x, -self->viewport.y);
-	gdk_cairo_set_source_pixbuf(context, self->pixbuf, 0.0, 0.0);
-	cairo_paint(context);
+	if(self->pixbuf && self->priv->mapping_is_identity)
+	{
+		gdk_cairo_set_source_pixbuf(context, self->pixbuf, 0.0, 0.0);
+		cairo_paint(context);
+	}
+	else
+	{
+		_gtk_scalable_image_draw_tiles(self, context);
+	}
+	_gtk_scalable_image_draw_overlays(self, context);
 	cairo_restore(context);
 	return TRUE;
 }
@@ -389,6 +855,21 @@ gtk_scalable_image_get_property(GObject*    object,
 		{
 			g_value_set_enum(value, self->vscroll_policy);
 		} break;
+
+		case PROP_BRIGHTNESS:
+		{
+			g_value_set_double(value, self->priv->brightness);
+		} break;
+
+		case PROP_CONTRAST:
+		{
+			g_value_set_double(value, self->priv->contrast);
+		} break;
+
+		case PROP_GAMMA:
+		{
+			g_value_set_double(value, self->priv->gamma);
+		} break;
 		
 		default:
 		{
@@ -441,6 +922,21 @@ gtk_scalable_image_set_property(GObject*      object,
 				// g_object_notify_by_pspec(object, param_spec);
 			}
 		} break;
+
+		case PROP_BRIGHTNESS:
+		{
+			gtk_scalable_image_set_brightness(self, g_value_get_double(value));
+		} break;
+
+		case PROP_CONTRAST:
+		{
+			gtk_scalable_image_set_contrast(self, g_value_get_double(value));
+		} break;
+
+		case PROP_GAMMA:
+		{
+			gtk_scalable_image_set_gamma(self, g_value_get_double(value));
+		} break;
 		
 		default:
 		{
@@ -472,6 +968,13 @@ gtk_scalable_image_finalize(GObject* object)
 		g_object_unref(self->pixbuf);
 		self->pixbuf = NULL;
 	}
+	g_clear_pointer(&self->priv->data,  g_bytes_unref);
+	g_clear_pointer(&self->priv->lut,   g_free);
+	g_clear_pointer(&self->priv->table, g_free);
+	g_clear_pointer(&self->priv->tiles, g_hash_table_destroy);
+	g_clear_pointer(&self->priv->mips,  g_ptr_array_unref);
+	g_clear_pointer(&self->priv->overlays,      g_ptr_array_unref);
+	g_clear_pointer(&self->priv->overlay_trees, g_array_unref);
 	
 	G_OBJECT_CLASS(gtk_scalable_image_parent_class)->finalize(object);
 }
@@ -488,6 +991,19 @@ gtk_scalable_image_init(GtkScalableImage* self)
 	self->hscroll_policy = GTK_SCROLL_MINIMUM;
 	self->vscroll_policy = GTK_SCROLL_MINIMUM;
 
+	self->priv             = gtk_scalable_image_get_instance_private(self);
+	self->priv->brightness = 0.0;
+	self->priv->contrast   = 1.0;
+	self->priv->gamma      = 1.0;
+	self->priv->tiles      = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _gtk_scalable_image_tile_free);
+	self->priv->mips       = g_ptr_array_new_with_free_func(_gtk_scalable_image_mip_free);
+
+	self->priv->overlays      = g_ptr_array_new_with_free_func(_gtk_scalable_image_overlay_free);
+	self->priv->overlay_trees = g_array_new(FALSE, FALSE, sizeof(OverlayTree));
+	g_array_set_clear_func(self->priv->overlay_trees, _gtk_scalable_image_overlay_tree_clear);
+	_gtk_scalable_image_reset_window(self);
+	_gtk_scalable_image_update_mapping(self);
+
 	// self->hadjustment = GTK_ADJUSTMENT(gtk_adjustment_new(0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
 	// g_object_ref(self->hadjustment);
 	// g_object_ref_sink(self->hadjustment);
@@ -531,6 +1047,20 @@ gtk_scalable_image_class_init(GtkScalableImageClass* klass)
 	g_object_class_override_property(gobject_class, PROP_HSCROLL_POLICY, "hscroll-policy");
 	g_object_class_override_property(gobject_class, PROP_VSCROLL_POLICY, "vscroll-policy");
 
+	/* Display mapping, applied to the visible tiles at draw time */
+	properties[PROP_BRIGHTNESS] = g_param_spec_double("brightness", "Brightness", "Offset added to the windowed value",
+	                                                  -1.0, 1.0, 0.0,
+	                                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+	properties[PROP_CONTRAST]   = g_param_spec_double("contrast", "Contrast", "Factor applied to the windowed value around mid-grey",
+	                                                  0.0, G_MAXDOUBLE, 1.0,
+	                                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+	properties[PROP_GAMMA]      = g_param_spec_double("gamma", "Gamma", "Gamma correction applied after brightness and contrast",
+	                                                  G_MINDOUBLE, G_MAXDOUBLE, 1.0,
+	                                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+	g_object_class_install_property(gobject_class, PROP_BRIGHTNESS, properties[PROP_BRIGHTNESS]);
+	g_object_class_install_property(gobject_class, PROP_CONTRAST,   properties[PROP_CONTRAST]);
+	g_object_class_install_property(gobject_class, PROP_GAMMA,      properties[PROP_GAMMA]);
+
 	// gtk_widget_class_set_css_name(widget_class, "scrollableimage");
 }
 
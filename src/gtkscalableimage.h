@@ -44,6 +44,20 @@ struct _GtkScalableImage
 	GtkScalableImagePrivate* priv;
 };
 
+/* Sample formats accepted by gtk_scalable_image_set_data() */
+typedef enum
+{
+	GTK_SCALABLE_IMAGE_FORMAT_UINT8,
+	GTK_SCALABLE_IMAGE_FORMAT_UINT16,
+	GTK_SCALABLE_IMAGE_FORMAT_FLOAT,
+} GtkScalableImageFormat;
+
+/* Receives one band of the output of gtk_scalable_image_render_region_banded().
+ * y is the offset of the band's first row in the output. Return FALSE to stop rendering */
+typedef gboolean (*GtkScalableImageBandFunc) (cairo_surface_t* band,
+                                              gint             y,
+                                              gpointer         user_data);
+
 struct _GtkScalableImageClass
 {
 	GtkWidgetClass base;
@@ -67,6 +81,58 @@ void           gtk_scalable_image_set_scale_to_fit   (GtkScalableImage* self);
 void           gtk_scalable_image_translate          (GtkScalableImage* self,
                                                       gint              delta_x,
                                                       gint              delta_y);
+void           gtk_scalable_image_set_data           (GtkScalableImage*      self,
+                                                      GBytes*                data,
+                                                      GtkScalableImageFormat format,
+                                                      gint                   n_channels,
+                                                      gint                   width,
+                                                      gint                   height,
+                                                      gint                   rowstride);
+GBytes*        gtk_scalable_image_get_data           (GtkScalableImage* self);
+void           gtk_scalable_image_set_window_level   (GtkScalableImage* self,
+                                                      double            window,
+                                                      double            level);
+void           gtk_scalable_image_get_window_level   (GtkScalableImage* self,
+                                                      double*           window,
+                                                      double*           level);
+double         gtk_scalable_image_get_brightness     (GtkScalableImage* self);
+void           gtk_scalable_image_set_brightness     (GtkScalableImage* self,
+                                                      double            brightness);
+double         gtk_scalable_image_get_contrast       (GtkScalableImage* self);
+void           gtk_scalable_image_set_contrast       (GtkScalableImage* self,
+                                                      double            contrast);
+double         gtk_scalable_image_get_gamma          (GtkScalableImage* self);
+void           gtk_scalable_image_set_gamma          (GtkScalableImage* self,
+                                                      double            gamma);
+const guint32* gtk_scalable_image_get_lut            (GtkScalableImage* self);
+void           gtk_scalable_image_set_lut            (GtkScalableImage* self,
+                                                      const guint32*    lut);
+guint          gtk_scalable_image_add_rectangle      (GtkScalableImage* self,
+                                                      double            x,
+                                                      double            y,
+                                                      double            width,
+                                                      double            height,
+                                                      const GdkRGBA*    color);
+guint          gtk_scalable_image_add_polygon        (GtkScalableImage* self,
+                                                      const double*     points,
+                                                      gint              n_points,
+                                                      const GdkRGBA*    color);
+void           gtk_scalable_image_remove_overlay     (GtkScalableImage* self,
+                                                      guint             id);
+void           gtk_scalable_image_clear_overlays     (GtkScalableImage* self);
+guint          gtk_scalable_image_get_overlay_at_point (GtkScalableImage* self,
+                                                        gint              viewport_x,
+                                                        gint              viewport_y);
+cairo_surface_t* gtk_scalable_image_render_region        (GtkScalableImage*        self,
+                                                          const GdkRectangle*      region,
+                                                          gint                     width,
+                                                          gint                     height);
+gboolean         gtk_scalable_image_render_region_banded (GtkScalableImage*        self,
+                                                          const GdkRectangle*      region,
+                                                          gint                     width,
+                                                          gint                     height,
+                                                          GtkScalableImageBandFunc func,
+                                                          gpointer                 user_data);
 
 
 G_END_DECLS
@@ -0,0 +1,523 @@
+/* Drives GtkScalableImage offscreen, compares what draw() renders against the images in tests/golden and checks overlay hit testing.
+ * Built with -DGTK_SCALABLE_IMAGE_BUILD_TESTS=ON, run with "ctest --test-dir build".
+ * Run with GTK_SCALABLE_IMAGE_UPDATE_GOLDEN=1 to rewrite the golden images from the current output */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtkscalableimage.h"
+
+/* Largest difference allowed in each channel, which absorbs the rounding of cairo's bilinear filter */
+#define TOLERANCE 2
+/* Exit status that makes CTest report the test as skipped */
+#define SKIP_CODE 77
+
+/* A small image for the viewport logic, and a large one that has enough tiles and mip levels to time */
+#define SMALL_WIDTH  64
+#define SMALL_HEIGHT 48
+#define LARGE_SIZE   2048
+
+/* Enough random rectangles to merge several index trees and to compact the removed ones */
+#define OVERLAY_COUNT  3000
+#define OVERLAY_PROBES 500
+#define OVERLAY_BUDGET 200000
+
+
+/* SOURCE_PIXBUF holds the small image too, and is painted directly instead of through the tiles */
+typedef enum
+{
+	SOURCE_SMALL,
+	SOURCE_LARGE,
+	SOURCE_PIXBUF,
+} Source;
+
+typedef struct
+{
+	const gchar* name;
+	const gchar* golden;
+	Source       source;
+	void       (*run)(GtkScalableImage* image);
+	double       scale;
+	GdkRectangle viewport;
+	gint64       budget; /* microseconds, covering run() and draw() */
+} Scenario;
+
+/* Reference copy of an overlay added by check_overlays() */
+typedef struct
+{
+	guint    id;
+	double   x1, y1, x2, y2;
+	gboolean removed;
+} Rectangle;
+
+
+static
+void
+allocate(GtkScalableImage* image, gint width, gint height)
+{
+	GtkAllocation allocation = { 0, 0, width, height };
+	gtk_widget_size_allocate(GTK_WIDGET(image), &allocation);
+}
+
+
+/* Fitting is the initial mode, so the first allocation fits the image too.
+ * The 64x64 viewport is as wide as the image and taller, so it is centered vertically only */
+static
+void
+run_fit(GtkScalableImage* image)
+{
+	allocate(image, 128, 128);
+	gtk_scalable_image_set_scale(image, 1.0);
+	gtk_scalable_image_set_scale_to_fit(image);
+}
+
+
+/* Zooming in moves the centered viewport back inside the image */
+static
+void
+run_scale(GtkScalableImage* image)
+{
+	allocate(image, 64, 64);
+	gtk_scalable_image_set_scale(image, 2.0);
+}
+
+
+/* The image point under (48, 40) stays there */
+static
+void
+run_scale_at_point(GtkScalableImage* image)
+{
+	allocate(image, 64, 64);
+	gtk_scalable_image_set_scale_at_point(image, 2.0, 48, 40);
+}
+
+
+/* Translations stop at the right and bottom edges of the image */
+static
+void
+run_translate(GtkScalableImage* image)
+{
+	allocate(image, 64, 64);
+	gtk_scalable_image_set_scale(image, 2.0);
+	gtk_scalable_image_translate(image, 100, 5);
+	gtk_scalable_image_translate(image, 0, 100);
+}
+
+
+/* Growing the allocation of a scrolled image clamps and recenters the viewport, which must match fitting */
+static
+void
+run_resize(GtkScalableImage* image)
+{
+	allocate(image, 64, 64);
+	gtk_scalable_image_set_scale(image, 2.0);
+	gtk_scalable_image_translate(image, 32, 16);
+	allocate(image, 128, 128);
+}
+
+
+/* A viewport larger than the image on both axes is centered on both */
+static
+void
+run_zoom_out(GtkScalableImage* image)
+{
+	allocate(image, 128, 128);
+	gtk_scalable_image_set_scale(image, 0.5);
+}
+
+
+/* Draws the whole image from its third mip level */
+static
+void
+run_fit_large(GtkScalableImage* image)
+{
+	allocate(image, 512, 512);
+}
+
+
+static
+void
+run_pan(GtkScalableImage* image)
+{
+	allocate(image, 512, 512);
+	gtk_scalable_image_set_scale(image, 1.0);
+	gtk_scalable_image_translate(image, 700, 300);
+	gtk_scalable_image_translate(image, 2000, -1000);
+}
+
+
+static const Scenario scenarios[] =
+{
+	{ "fit",            "fit.png",            SOURCE_SMALL,  run_fit,            2.0,  {    0,   -8,   64,   64 },  50000 },
+	{ "scale",          "scale.png",          SOURCE_SMALL,  run_scale,          2.0,  {    0,    0,   32,   32 },  50000 },
+	{ "scale-at-point", "scale-at-point.png", SOURCE_SMALL,  run_scale_at_point, 2.0,  {   24,   12,   32,   32 },  50000 },
+	{ "translate",      "translate.png",      SOURCE_SMALL,  run_translate,      2.0,  {   32,   16,   32,   32 },  50000 },
+	{ "resize",         "fit.png",            SOURCE_SMALL,  run_resize,         2.0,  {    0,   -8,   64,   64 },  50000 },
+	{ "zoom-out",       "zoom-out.png",       SOURCE_SMALL,  run_zoom_out,       0.5,  {  -96, -104,  256,  256 },  50000 },
+	{ "pixbuf-fit",     "pixbuf-fit.png",     SOURCE_PIXBUF, run_fit,            2.0,  {    0,   -8,   64,   64 },  50000 },
+	{ "pixbuf-scale",   "pixbuf-scale.png",   SOURCE_PIXBUF, run_scale,          2.0,  {    0,    0,   32,   32 },  50000 },
+	{ "fit-large",      "fit-large.png",      SOURCE_LARGE,  run_fit_large,      0.25, {    0,    0, 2048, 2048 }, 200000 },
+	{ "pan",            "pan.png",            SOURCE_LARGE,  run_pan,            1.0,  { 1536,    0,  512,  512 }, 100000 },
+};
+
+
+/* RGB ramps under a checkerboard, chosen so that every mip level averages to whole values */
+static
+GBytes*
+create_small_image(void)
+{
+	guint8* samples = g_new(guint8, SMALL_WIDTH * SMALL_HEIGHT * 3);
+	for(gint y = 0; y < SMALL_HEIGHT; ++y)
+	{
+		for(gint x = 0; x < SMALL_WIDTH; ++x)
+		{
+			guint8* sample = samples + (y * SMALL_WIDTH + x) * 3;
+			sample[0] = (guint8)(x * 4);
+			sample[1] = (guint8)(y * 4);
+			sample[2] = ((x / 8 + y / 8) % 2) * 255;
+		}
+	}
+	return g_bytes_new_take(samples, SMALL_WIDTH * SMALL_HEIGHT * 3);
+}
+
+
+static
+GBytes*
+create_large_image(void)
+{
+	guint8* samples = g_new(guint8, LARGE_SIZE * LARGE_SIZE * 3);
+	for(gint y = 0; y < LARGE_SIZE; ++y)
+	{
+		for(gint x = 0; x < LARGE_SIZE; ++x)
+		{
+			guint8* sample = samples + ((gsize)y * LARGE_SIZE + x) * 3;
+			sample[0] = (guint8)(x / 4);
+			sample[1] = (guint8)(y / 4);
+			sample[2] = (((x ^ y) >> 6) & 1) * 255;
+		}
+	}
+	return g_bytes_new_take(samples, (gsize)LARGE_SIZE * LARGE_SIZE * 3);
+}
+
+
+static
+cairo_surface_t*
+draw(GtkScalableImage* image)
+{
+	GtkAllocation allocation;
+	gtk_widget_get_allocation(GTK_WIDGET(image), &allocation);
+
+	cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, allocation.width, allocation.height);
+	cairo_t*         context = cairo_create(surface);
+	gtk_widget_draw(GTK_WIDGET(image), context);
+	cairo_destroy(context);
+	cairo_surface_flush(surface);
+	return surface;
+}
+
+
+/* Returns TRUE if every channel of every pixel is within TOLERANCE of the golden image */
+static
+gboolean
+compare(const Scenario* scenario, cairo_surface_t* actual, const gchar* golden_path)
+{
+	cairo_surface_t* expected = cairo_image_surface_create_from_png(golden_path);
+	if(cairo_surface_status(expected) != CAIRO_STATUS_SUCCESS)
+	{
+		fprintf(stderr, "%s: cannot load %s: %s\n", scenario->name, golden_path,
+		        cairo_status_to_string(cairo_surface_status(expected)));
+		cairo_surface_destroy(expected);
+		return FALSE;
+	}
+
+	gint width  = cairo_image_surface_get_width(actual);
+	gint height = cairo_image_surface_get_height(actual);
+	if(cairo_image_surface_get_format(expected) != CAIRO_FORMAT_ARGB32 ||
+	   cairo_image_surface_get_width(expected)  != width               ||
+	   cairo_image_surface_get_height(expected) != height)
+	{
+		fprintf(stderr, "%s: %s is not a %dx%d ARGB image\n", scenario->name, golden_path, width, height);
+		cairo_surface_destroy(expected);
+		return FALSE;
+	}
+
+	gint mismatches    = 0;
+	gint largest_error = 0;
+	for(gint y = 0; y < height; ++y)
+	{
+		const guint8* actual_row   = cairo_image_surface_get_data(actual)   + y * cairo_image_surface_get_stride(actual);
+		const guint8* expected_row = cairo_image_surface_get_data(expected) + y * cairo_image_surface_get_stride(expected);
+		for(gint x = 0; x < width * 4; x += 4)
+		{
+			gint error = 0;
+			for(gint c = 0; c < 4; ++c)
+				error = MAX(error, ABS(actual_row[x + c] - expected_row[x + c]));
+			if(error > TOLERANCE)
+				mismatches += 1;
+			largest_error = MAX(largest_error, error);
+		}
+	}
+	cairo_surface_destroy(expected);
+
+	if(mismatches > 0)
+	{
+		gchar* actual_path = g_strdup_printf("%s.actual.png", scenario->name);
+		cairo_surface_write_to_png(actual, actual_path);
+		fprintf(stderr, "%s: %d pixels differ from %s by up to %d, output written to %s\n",
+		        scenario->name, mismatches, golden_path, largest_error, actual_path);
+		g_free(actual_path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+static
+gboolean
+run_scenario(const Scenario* scenario, GBytes* small_image, GBytes* large_image, const gchar* golden_dir, gboolean update)
+{
+	GtkScalableImage* image = GTK_SCALABLE_IMAGE(gtk_scalable_image_new());
+	switch(scenario->source)
+	{
+		case SOURCE_SMALL:
+		{
+			gtk_scalable_image_set_data(image, small_image, GTK_SCALABLE_IMAGE_FORMAT_UINT8, 3, SMALL_WIDTH, SMALL_HEIGHT, SMALL_WIDTH * 3);
+		} break;
+
+		case SOURCE_LARGE:
+		{
+			gtk_scalable_image_set_data(image, large_image, GTK_SCALABLE_IMAGE_FORMAT_UINT8, 3, LARGE_SIZE, LARGE_SIZE, LARGE_SIZE * 3);
+		} break;
+
+		case SOURCE_PIXBUF:
+		{
+			GdkPixbuf* pixbuf = gdk_pixbuf_new_from_bytes(small_image, GDK_COLORSPACE_RGB, FALSE, 8, SMALL_WIDTH, SMALL_HEIGHT, SMALL_WIDTH * 3);
+			gtk_scalable_image_set_pixbuf(image, pixbuf);
+			g_object_unref(pixbuf);
+		} break;
+	}
+
+	/* The widget has its own GdkWindow, which needs a realized parent */
+	GtkWidget* window = gtk_offscreen_window_new();
+	gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(image));
+	gtk_widget_show_all(window);
+
+	gint64 start = g_get_monotonic_time();
+	scenario->run(image);
+	cairo_surface_t* surface = draw(image);
+	gint64 duration = g_get_monotonic_time() - start;
+
+	gboolean passed = TRUE;
+	if(duration > scenario->budget)
+	{
+		fprintf(stderr, "%s: took %.2f ms, the budget is %.2f ms\n", scenario->name, duration / 1000.0, scenario->budget / 1000.0);
+		passed = FALSE;
+	}
+
+	if(image->scale != scenario->scale)
+	{
+		fprintf(stderr, "%s: scale is %g instead of %g\n", scenario->name, image->scale, scenario->scale);
+		passed = FALSE;
+	}
+
+	const GdkRectangle* viewport = &scenario->viewport;
+	if(!gdk_rectangle_equal(&image->viewport, viewport))
+	{
+		fprintf(stderr, "%s: viewport is (%d, %d, %d, %d) instead of (%d, %d, %d, %d)\n", scenario->name,
+		        image->viewport.x, image->viewport.y, image->viewport.width, image->viewport.height,
+		        viewport->x, viewport->y, viewport->width, viewport->height);
+		passed = FALSE;
+	}
+
+	gchar* golden_path = g_build_filename(golden_dir, scenario->golden, NULL);
+	if(update)
+		cairo_surface_write_to_png(surface, golden_path);
+	else if(!compare(scenario, surface, golden_path))
+		passed = FALSE;
+	g_free(golden_path);
+
+	printf("%-16s %-4s %8.2f ms\n", scenario->name, passed ? "ok" : "FAIL", duration / 1000.0);
+
+	cairo_surface_destroy(surface);
+	gtk_widget_destroy(window);
+	return passed;
+}
+
+
+/* The id of the overlay under a point in image coordinates. The scale must be 1 */
+static
+guint
+hit(GtkScalableImage* image, gint x, gint y)
+{
+	return gtk_scalable_image_get_overlay_at_point(image, x - image->viewport.x, y - image->viewport.y);
+}
+
+
+static
+void
+add_random_rectangles(GtkScalableImage* image, GArray* rectangles, GRand* generator, gint count)
+{
+	GdkRGBA color = { 1.0, 0.0, 0.0, 1.0 };
+	for(gint i = 0; i < count; ++i)
+	{
+		Rectangle rectangle;
+		rectangle.x1      = g_rand_int_range(generator, 0, SMALL_WIDTH);
+		rectangle.y1      = g_rand_int_range(generator, 0, SMALL_HEIGHT);
+		rectangle.x2      = rectangle.x1 + g_rand_int_range(generator, 0, 12);
+		rectangle.y2      = rectangle.y1 + g_rand_int_range(generator, 0, 12);
+		rectangle.removed = FALSE;
+		rectangle.id      = gtk_scalable_image_add_rectangle(image, rectangle.x1, rectangle.y1,
+		                                                     rectangle.x2 - rectangle.x1, rectangle.y2 - rectangle.y1, &color);
+		g_array_append_val(rectangles, rectangle);
+	}
+}
+
+
+static
+void
+remove_random_rectangles(GtkScalableImage* image, GArray* rectangles, GRand* generator, double probability)
+{
+	for(guint i = 0; i < rectangles->len; ++i)
+	{
+		Rectangle* rectangle = &g_array_index(rectangles, Rectangle, i);
+		if(g_rand_double(generator) < probability)
+		{
+			gtk_scalable_image_remove_overlay(image, rectangle->id);
+			rectangle->removed = TRUE;
+		}
+	}
+}
+
+
+/* Compares hit testing at random points with a linear search for the last added rectangle that is not removed.
+ * Returns the number of points where they differ */
+static
+gint
+probe_rectangles(GtkScalableImage* image, GArray* rectangles, GRand* generator)
+{
+	gint errors = 0;
+	for(gint i = 0; i < OVERLAY_PROBES; ++i)
+	{
+		gint  x        = g_rand_int_range(generator, 0, SMALL_WIDTH);
+		gint  y        = g_rand_int_range(generator, 0, SMALL_HEIGHT);
+		guint expected = 0;
+		for(gint j = (gint)rectangles->len - 1; j >= 0 && expected == 0; --j)
+		{
+			Rectangle* rectangle = &g_array_index(rectangles, Rectangle, j);
+			if(!rectangle->removed && x >= rectangle->x1 && x <= rectangle->x2 && y >= rectangle->y1 && y <= rectangle->y2)
+				expected = rectangle->id;
+		}
+		if(hit(image, x, y) != expected)
+			errors += 1;
+	}
+	return errors;
+}
+
+
+/* Hit testing on a few layered shapes, then on random rectangles across index merges and compactions */
+static
+gboolean
+check_overlays(GBytes* small_image)
+{
+	GtkScalableImage* image = GTK_SCALABLE_IMAGE(gtk_scalable_image_new());
+	gtk_scalable_image_set_data(image, small_image, GTK_SCALABLE_IMAGE_FORMAT_UINT8, 3, SMALL_WIDTH, SMALL_HEIGHT, SMALL_WIDTH * 3);
+	GtkWidget* window = gtk_offscreen_window_new();
+	gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(image));
+	gtk_widget_show_all(window);
+	allocate(image, SMALL_WIDTH, SMALL_WIDTH);
+
+	gboolean passed = TRUE;
+	gint64   start  = g_get_monotonic_time();
+
+	GdkRGBA      color       = { 0.0, 1.0, 0.0, 1.0 };
+	const double triangle[6] = { 0.0, 0.0, 30.0, 0.0, 0.0, 30.0 };
+	guint outer_id    = gtk_scalable_image_add_rectangle(image, 0.0, 0.0, 40.0, 40.0, &color);
+	guint inner_id    = gtk_scalable_image_add_rectangle(image, 10.0, 10.0, 10.0, 10.0, &color);
+	guint triangle_id = gtk_scalable_image_add_polygon(image, triangle, 3, &color);
+
+	guint hits[6];
+	hits[0] = hit(image, 12, 12); /* in all three, the triangle is topmost */
+	hits[1] = hit(image, 18, 18); /* in both rectangles, outside the triangle */
+	hits[2] = hit(image, 50, 5);
+	gtk_scalable_image_remove_overlay(image, triangle_id);
+	gtk_scalable_image_remove_overlay(image, triangle_id); /* removing twice is harmless */
+	hits[3] = hit(image, 12, 12);
+	gtk_scalable_image_remove_overlay(image, inner_id);
+	hits[4] = hit(image, 18, 18);
+	gtk_scalable_image_clear_overlays(image);
+	hits[5] = hit(image, 18, 18);
+
+	const guint expected[6] = { triangle_id, inner_id, 0, inner_id, outer_id, 0 };
+	for(gint i = 0; i < 6; ++i)
+	{
+		if(hits[i] != expected[i])
+		{
+			fprintf(stderr, "overlays: hit %d is overlay %u instead of %u\n", i, hits[i], expected[i]);
+			passed = FALSE;
+		}
+	}
+
+	GRand*  generator  = g_rand_new_with_seed(1);
+	GArray* rectangles = g_array_new(FALSE, FALSE, sizeof(Rectangle));
+	gint    errors[3];
+	add_random_rectangles(image, rectangles, generator, OVERLAY_COUNT);
+	errors[0] = probe_rectangles(image, rectangles, generator);
+	remove_random_rectangles(image, rectangles, generator, 0.7);
+	errors[1] = probe_rectangles(image, rectangles, generator);
+	add_random_rectangles(image, rectangles, generator, OVERLAY_COUNT / 3);
+	errors[2] = probe_rectangles(image, rectangles, generator);
+	for(gint i = 0; i < 3; ++i)
+	{
+		if(errors[i] > 0)
+		{
+			fprintf(stderr, "overlays: %d of %d random points hit the wrong overlay in phase %d\n", errors[i], OVERLAY_PROBES, i);
+			passed = FALSE;
+		}
+	}
+	g_array_free(rectangles, TRUE);
+	g_rand_free(generator);
+
+	gint64 duration = g_get_monotonic_time() - start;
+	if(duration > OVERLAY_BUDGET)
+	{
+		fprintf(stderr, "overlays: took %.2f ms, the budget is %.2f ms\n", duration / 1000.0, OVERLAY_BUDGET / 1000.0);
+		passed = FALSE;
+	}
+
+	printf("%-16s %-4s %8.2f ms\n", "overlays", passed ? "ok" : "FAIL", duration / 1000.0);
+
+	gtk_widget_destroy(window);
+	return passed;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	/* CTest runs the test under xvfb-run when it is installed, and only treats SKIP_CODE as a skip otherwise */
+	if(!gtk_init_check(&argc, &argv))
+	{
+		fprintf(stderr, "No display available, skipping\n");
+		return SKIP_CODE;
+	}
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <golden image directory>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	gboolean update      = g_getenv("GTK_SCALABLE_IMAGE_UPDATE_GOLDEN") != NULL;
+	GBytes*  small_image = create_small_image();
+	GBytes*  large_image = create_large_image();
+
+	gint failures = 0;
+	for(gsize i = 0; i < G_N_ELEMENTS(scenarios); ++i)
+		if(!run_scenario(&scenarios[i], small_image, large_image, argv[1], update))
+			failures += 1;
+	if(!check_overlays(small_image))
+		failures += 1;
+
+	g_bytes_unref(large_image);
+	g_bytes_unref(small_image);
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}